@@ -54,6 +54,24 @@ i32_t main(void) {
     ecs_entity_add(ecs, jerry, foo);
     ecs_entity_add(ecs, jerry, baz);
 
+    ecs_entity_t mover = ecs_entity_new(ecs);
+    ecs_entity_add(ecs, mover, ecs_component_id(ecs, position_t));
+    ecs_entity_add(ecs, mover, ecs_component_id(ecs, velocity_t));
+    position_t *mover_pos = ecs_get(ecs, mover, position_t);
+    mover_pos->x = 0.0f;
+    mover_pos->y = 0.0f;
+    velocity_t *mover_vel = ecs_get(ecs, mover, velocity_t);
+    mover_vel->x = 1.0f;
+    mover_vel->y = 2.0f;
+
+    ecs_each2(ecs, position_t, pos, velocity_t, vel, {
+        pos->x += vel->x;
+        pos->y += vel->y;
+    });
+
+    mover_pos = ecs_get(ecs, mover, position_t);
+    re_log_debug("%f, %f", mover_pos->x, mover_pos->y);
+
     archetype_graph_print(ecs, ecs->archetype_graph);
 
     ecs_free(ecs);
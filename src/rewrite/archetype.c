@@ -31,6 +31,12 @@ archetype_graph_t archetype_graph_init(void) {
 void archetype_free(archetype_t *archetype) {
     type_free(&archetype->type);
     re_hash_map_free(archetype->edge_map);
+    re_dyn_arr_free(archetype->bitset);
+    re_dyn_arr_free(archetype->ids);
+    for (u32_t i = 0; i < re_dyn_arr_count(archetype->storage); i++) {
+        re_dyn_arr_free(archetype->storage[i]);
+    }
+    re_dyn_arr_free(archetype->storage);
     *archetype = (archetype_t) {0};
 }
 
@@ -40,9 +46,96 @@ void archetype_graph_free(archetype_graph_t *graph) {
     }
     re_dyn_arr_free(graph->archetypes);
     re_hash_map_free(graph->archetype_map);
+    re_hash_map_free(graph->id_map);
+    re_hash_map_free(graph->storage_map);
+    re_hash_map_free(graph->bit_map);
+    re_dyn_arr_free(graph->queries);
     *graph = (archetype_graph_t) {0};
 }
 
+static void *column_copy(void *column) {
+    if (column == NULL) {
+        return NULL;
+    }
+
+    u64_t size = re_dyn_arr_size(column);
+    u32_t count = re_dyn_arr_count(column);
+
+    void *copy = NULL;
+    re_dyn_arr_new(copy, size);
+    re_dyn_arr_reserve(copy, count);
+    memcpy(copy, column, count * size);
+
+    return copy;
+}
+
+archetype_graph_t archetype_graph_copy(archetype_graph_t *graph) {
+    archetype_graph_t copy = {0};
+    re_hash_map_init(copy.archetype_map, NULL, NULL, hash_type, eq_type);
+
+    // Build all archetypes first so the array doesn't move while pointers get remapped.
+    for (u32_t i = 0; i < re_dyn_arr_count(graph->archetypes); i++) {
+        archetype_t *src = &graph->archetypes[i];
+        archetype_t dst = {
+            .index = src->index,
+            .type = type_copy(src->type),
+        };
+
+        re_dyn_arr_push_arr(dst.ids, src->ids, re_dyn_arr_count(src->ids));
+        re_dyn_arr_push_arr(dst.bitset, src->bitset, re_dyn_arr_count(src->bitset));
+        for (u32_t j = 0; j < re_dyn_arr_count(src->storage); j++) {
+            re_dyn_arr_push(dst.storage, column_copy(src->storage[j]));
+        }
+
+        re_dyn_arr_push(copy.archetypes, dst);
+    }
+
+    for (u32_t i = 0; i < re_dyn_arr_count(graph->archetypes); i++) {
+        archetype_t *src = &graph->archetypes[i];
+        archetype_t *dst = &copy.archetypes[i];
+
+        for (re_hash_map_iter_t iter = re_hash_map_iter_get(src->edge_map);
+            re_hash_map_iter_valid(iter);
+            iter = re_hash_map_iter_next(src->edge_map, iter)) {
+            ecs_id_t id = re_hash_map_get_index_key(src->edge_map, iter);
+            archetype_edge_t edge = re_hash_map_get_index_value(src->edge_map, iter);
+            edge.add = &copy.archetypes[edge.add->index];
+            edge.remove = &copy.archetypes[edge.remove->index];
+            re_hash_map_set(dst->edge_map, id, edge);
+        }
+
+        re_hash_map_set(copy.archetype_map, dst->type, dst);
+    }
+
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(graph->id_map);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(graph->id_map, iter)) {
+        ecs_id_t id = re_hash_map_get_index_key(graph->id_map, iter);
+        archetype_record_t record = re_hash_map_get_index_value(graph->id_map, iter);
+        record.archetype = &copy.archetypes[record.archetype->index];
+        re_hash_map_set(copy.id_map, id, record);
+    }
+
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(graph->storage_map);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(graph->storage_map, iter)) {
+        ecs_id_t id = re_hash_map_get_index_key(graph->storage_map, iter);
+        u64_t size = re_hash_map_get_index_value(graph->storage_map, iter);
+        re_hash_map_set(copy.storage_map, id, size);
+    }
+
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(graph->bit_map);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(graph->bit_map, iter)) {
+        ecs_id_t id = re_hash_map_get_index_key(graph->bit_map, iter);
+        u32_t bit = re_hash_map_get_index_value(graph->bit_map, iter);
+        re_hash_map_set(copy.bit_map, id, bit);
+    }
+    copy.bit_count = graph->bit_count;
+
+    return copy;
+}
+
 static ecs_id_t type_diff(const type_t a, const type_t b) {
     RE_ASSERT(re_dyn_arr_count(a) > re_dyn_arr_count(b), "Type a must have more id's than b.");
 
@@ -92,6 +185,18 @@ static void archetype_make_edges(archetype_graph_t *graph, archetype_t *archetyp
     }
 }
 
+u32_t archetype_graph_id_bit(archetype_graph_t *graph, ecs_id_t id) {
+    if (re_hash_map_has(graph->bit_map, id)) {
+        return re_hash_map_get(graph->bit_map, id);
+    }
+
+    u32_t bit = graph->bit_count;
+    graph->bit_count++;
+    re_hash_map_set(graph->bit_map, id, bit);
+
+    return bit;
+}
+
 static archetype_t *archetype_graph_add(archetype_graph_t *graph, const type_t type) {
     archetype_t *archetype = re_hash_map_get(graph->archetype_map, type);
     if (archetype != NULL) {
@@ -114,11 +219,22 @@ static archetype_t *archetype_graph_add(archetype_graph_t *graph, const type_t t
         re_dyn_arr_new(archetype->storage[i], size);
     }
 
+    for (u32_t i = 0; i < re_dyn_arr_count(archetype->type); i++) {
+        u32_t bit = archetype_graph_id_bit(graph, archetype->type[i]);
+        while (re_dyn_arr_count(archetype->bitset) <= bit / 64) {
+            re_dyn_arr_push(archetype->bitset, 0);
+        }
+        archetype->bitset[bit / 64] |= 1ull << (bit % 64);
+    }
+
     re_hash_map_set(graph->archetype_map, archetype->type, archetype);
 
     archetype_make_edges(graph, archetype);
 
-    for (u32_t i = 0; i < re_dyn_arr_count(archetype->type); i++) {
+    for (u32_t i = 0; i < re_dyn_arr_count(graph->queries); i++) {
+        if (query_match(graph->queries[i], archetype)) {
+            re_dyn_arr_push(graph->queries[i]->matches, archetype->index);
+        }
     }
 
     return archetype;
@@ -238,6 +354,20 @@ void *archetype_get_storage_id(archetype_graph_t graph, archetype_record_t recor
     return NULL;
 }
 
+void *archetype_get_column(archetype_graph_t *graph, archetype_t *archetype, ecs_id_t id) {
+    if (!re_hash_map_has(graph->storage_map, id)) {
+        return NULL;
+    }
+
+    for (u32_t i = 0; i < re_dyn_arr_count(archetype->type); i++) {
+        if (archetype->type[i] == id) {
+            return archetype->storage[i];
+        }
+    }
+
+    return NULL;
+}
+
 archetype_t *archetype_graph_get(archetype_graph_t *graph, type_t type) {
     return re_hash_map_get(graph->archetype_map, type);
 }
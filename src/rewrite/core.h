@@ -1,6 +1,7 @@
 #pragma once
 
 #include <rebound.h>
+#include <pthread.h>
 
 typedef u64_t ecs_id_t;
 
@@ -8,6 +9,26 @@ typedef u64_t ecs_id_t;
 // ID handler
 /*=========================*/
 
+// Range of id data claimed by an id cache, bounds inclusive.
+typedef struct id_range_t id_range_t;
+struct id_range_t {
+    u32_t lower;
+    u32_t upper;
+    // Ranges stay reserved after their cache is freed since id's from it may still be alive.
+    // An unused range can be claimed again by another cache.
+    b8_t in_use;
+};
+
+// A range of id's that had their generation bumped.
+typedef struct id_invalidation_t id_invalidation_t;
+struct id_invalidation_t {
+    u32_t lower;
+    u32_t upper;
+    // Id's within reserved cache ranges won't be handed out again by the
+    // range owner, so pending ones get their generation refreshed instead of dropped.
+    b8_t keep_reserved;
+};
+
 typedef struct id_handler_t id_handler_t;
 struct id_handler_t {
     // Map id's to a generation for livliness tracking.
@@ -18,8 +39,22 @@ struct id_handler_t {
     u32_t range_lower;
     u32_t range_upper;
     u32_t range_offest;
+
+    // Dedicated cache ranges, skipped when generating id's from the range above.
+    re_dyn_arr_t(id_range_t) reserved_ranges;
+
+    // Every invalidation so far, caches apply the ones they haven't seen to their own lists.
+    re_dyn_arr_t(id_invalidation_t) invalidations;
+    // Count of 'invalidations', read atomically by caches without taking the lock.
+    u32_t invalidation_count;
+
+    // Guards everything above. Id creation and disposal write, 'id_valid' reads.
+    pthread_rwlock_t lock;
 };
 
+extern void id_handler_init(id_handler_t *handler);
+// Copy all state of 'src' into an initialized but unused 'dst'.
+extern void id_handler_copy(id_handler_t *dst, id_handler_t *src);
 // Free resources used by 'id handler'.
 extern void id_handler_free(id_handler_t *handler);
 // Changing the range will reset the range offset and invalidate all existing ids in that range.
@@ -35,6 +70,41 @@ extern u32_t id_get_data(ecs_id_t id);
 // Read the generation part of the id.
 extern u16_t id_get_gen(ecs_id_t id);
 
+// Amount of id's a cache reserves from its range at a time.
+#define ID_CACHE_BLOCK_SIZE 1024
+
+// Per thread id allocator. Id's are handed out from blocks reserved from the
+// handler so the handler lock is only taken once per block and on disposal.
+// A cache must only be used from one thread at a time.
+typedef struct id_cache_t id_cache_t;
+struct id_cache_t {
+    id_handler_t *handler;
+    // Thread local list of disposed id's for recycling.
+    re_dyn_arr_t(ecs_id_t) free_ids;
+
+    // Dedicated range to reserve blocks from.
+    // An upper bound of 0 reserves from the range of the handler.
+    u32_t range_lower;
+    u32_t range_upper;
+    u32_t range_offset;
+
+    // Id's reserved from the range but not yet handed out.
+    re_dyn_arr_t(ecs_id_t) reserved;
+
+    // Handler invalidations already applied to the lists above.
+    u32_t invalidation_count;
+};
+
+extern id_cache_t id_cache_init(id_handler_t *handler);
+// Hands recycled and unused reserved id's back to the handler.
+extern void id_cache_free(id_cache_t *cache);
+// Give the cache its own range, e.g. one per worker or server, so it never competes with other caches.
+// The range is taken out of the handler's range. Fails if it overlaps the range of another live cache.
+// Changing the range invalidates all existing ids in that range.
+extern void id_cache_set_range(id_cache_t *cache, u32_t lower_bound, u32_t upper_bound);
+extern ecs_id_t id_cache_new(id_cache_t *cache);
+extern void id_cache_dispose(id_cache_t *cache, ecs_id_t id);
+
 /*=========================*/
 // Type
 /*=========================*/
@@ -70,6 +140,8 @@ struct archetype_t {
     re_hash_map_t(ecs_id_t, archetype_edge_t) edge_map;
     re_dyn_arr_t(ecs_id_t) ids;
     re_dyn_arr_t(re_dyn_arr_t(void)) storage;
+    // One bit per id in 'type', see 'archetype_graph_t.bit_map'.
+    re_dyn_arr_t(u64_t) bitset;
 };
 
 typedef struct archetype_record_t archetype_record_t;
@@ -79,27 +151,195 @@ struct archetype_record_t {
     u32_t column;
 };
 
+typedef struct query_t query_t;
+
 typedef struct archetype_graph_t archetype_graph_t;
 struct archetype_graph_t {
     re_dyn_arr_t(archetype_t) archetypes;
     re_hash_map_t(type_t, archetype_t *) archetype_map;
     re_hash_map_t(ecs_id_t, archetype_record_t) id_map;
     re_hash_map_t(ecs_id_t, u64_t) storage_map;
+
+    // Dense bit index for every id used in a type or query, keyed by the full id
+    // so a recycled id with a new generation never shares a bit with the dead one.
+    re_hash_map_t(ecs_id_t, u32_t) bit_map;
+    u32_t bit_count;
+    // Queries to update when a new archetype gets created.
+    re_dyn_arr_t(query_t *) queries;
 };
 
 extern archetype_graph_t archetype_graph_init(void);
 extern void archetype_graph_free(archetype_graph_t *graph);
+// Deep copy with columns copied in bulk. Registered queries aren't carried over.
+extern archetype_graph_t archetype_graph_copy(archetype_graph_t *graph);
 extern void archetype_free(archetype_t *archetype);
 
 extern void archetype_graph_record_add(archetype_graph_t *graph, archetype_record_t record, ecs_id_t id);
 extern void archetype_graph_record_remove(archetype_graph_t *graph, archetype_record_t record, ecs_id_t id);
 extern void archetype_add_storage_id(archetype_graph_t *graph, ecs_id_t id, u64_t size);
 extern void *archetype_get_storage_id(archetype_graph_t graph, archetype_record_t record, ecs_id_t id);
+// Get the base pointer of the column storing 'id'. NULL if the id has no storage or isn't part of the archetype.
+extern void *archetype_get_column(archetype_graph_t *graph, archetype_t *archetype, ecs_id_t id);
 
 extern archetype_t *archetype_graph_get(archetype_graph_t *graph, type_t type);
 extern archetype_record_t archetype_graph_get_id(archetype_graph_t *graph, ecs_id_t id);
 
 extern void archetype_graph_print_all(archetype_graph_t graph);
+extern u32_t archetype_graph_id_bit(archetype_graph_t *graph, ecs_id_t id);
+
+/*=========================*/
+// Query
+/*=========================*/
+
+#define QUERY_TERM_MAX 16
+
+typedef enum {
+    // Archetype must have the id.
+    QUERY_OP_AND,
+    // Archetype must not have the id.
+    QUERY_OP_NOT,
+    // Id doesn't affect matching but gets a column if present.
+    QUERY_OP_OPTIONAL,
+    // Or terms sharing a group index form a group where at least one id must be present.
+    QUERY_OP_OR,
+} query_op_t;
+
+typedef struct query_term_t query_term_t;
+struct query_term_t {
+    ecs_id_t id;
+    query_op_t op;
+    // Only used by or terms, must be less than 'QUERY_TERM_MAX'.
+    u32_t group;
+};
+
+#define query_and(ID) ((query_term_t) {(ID), QUERY_OP_AND, 0})
+#define query_not(ID) ((query_term_t) {(ID), QUERY_OP_NOT, 0})
+#define query_optional(ID) ((query_term_t) {(ID), QUERY_OP_OPTIONAL, 0})
+// Or(A, B) && Or(C, D):
+// query_or(A, 0), query_or(B, 0), query_or(C, 1), query_or(D, 1)
+#define query_or(ID, GROUP) ((query_term_t) {(ID), QUERY_OP_OR, (GROUP)})
+
+struct query_t {
+    re_dyn_arr_t(query_term_t) terms;
+
+    // Bitsets in the same layout as 'archetype_t.bitset'.
+    re_dyn_arr_t(u64_t) and_mask;
+    re_dyn_arr_t(u64_t) not_mask;
+    re_dyn_arr_t(re_dyn_arr_t(u64_t)) or_masks;
+
+    // Indices of matching archetypes, kept up to date as archetypes get created.
+    re_dyn_arr_t(u32_t) matches;
+};
+
+// Creates a query and registers it with the graph.
+// NULL if 'term_count' or an or group index exceeds 'QUERY_TERM_MAX'.
+extern query_t *query_create(archetype_graph_t *graph, const query_term_t *terms, u32_t term_count);
+extern void query_free(archetype_graph_t *graph, query_t *query);
+extern b8_t query_match(const query_t *query, const archetype_t *archetype);
+
+/*=========================*/
+// Thread pool
+/*=========================*/
+
+typedef void (*thread_pool_func_t)(void *arg);
+
+typedef struct thread_pool_job_t thread_pool_job_t;
+struct thread_pool_job_t {
+    thread_pool_func_t func;
+    void *arg;
+};
+
+typedef struct thread_pool_t thread_pool_t;
+struct thread_pool_t {
+    re_dyn_arr_t(pthread_t) threads;
+    re_dyn_arr_t(thread_pool_job_t) jobs;
+
+    pthread_mutex_t mutex;
+    // Signaled when a job gets submitted or the pool shuts down.
+    pthread_cond_t job_cond;
+    // Signaled when the last pending job finishes.
+    pthread_cond_t done_cond;
+
+    u32_t pending;
+    b8_t running;
+    // Hands out worker indices as threads start.
+    u32_t worker_counter;
+};
+
+// A thread count of 0 uses one thread per online core.
+extern thread_pool_t *thread_pool_create(u32_t thread_count);
+// Waits for all submitted jobs before joining the threads.
+extern void thread_pool_free(thread_pool_t *pool);
+extern void thread_pool_submit(thread_pool_t *pool, thread_pool_func_t func, void *arg);
+// Block until every submitted job has finished.
+extern void thread_pool_wait(thread_pool_t *pool);
+// Index of the calling thread within 'pool', U32_MAX if it isn't one of its workers.
+extern u32_t thread_pool_worker_index(thread_pool_t *pool);
+
+/*=========================*/
+// Name
+/*=========================*/
+
+// A string with its hash computed once.
+// Keep one around instead of a 're_str_t' to avoid rehashing on every lookup.
+typedef struct name_t name_t;
+struct name_t {
+    re_str_t str;
+    u64_t hash;
+};
+
+extern name_t name_from_str(re_str_t str);
+#define name_lit(LIT) name_from_str(re_str_lit(LIT))
+
+// Hash map callbacks for 'name_t' keys.
+extern u64_t name_hash(const void *key, u64_t size);
+extern b8_t name_eq(const void *a, const void *b, u32_t size);
+
+// Interned strings. The table owns the bytes of every name in it
+// so they stay valid until the table is freed.
+typedef struct name_table_t name_table_t;
+struct name_table_t {
+    re_hash_map_t(name_t, name_t) map;
+};
+
+extern name_table_t name_table_init(void);
+extern void name_table_free(name_table_t *table);
+// Get the interned copy of 'name', copying it into the table if it's new.
+extern name_t name_table_intern(name_table_t *table, name_t name);
+
+/*=========================*/
+// Spatial index
+/*=========================*/
+
+typedef struct spatial_entry_t spatial_entry_t;
+struct spatial_entry_t {
+    ecs_id_t entity;
+    f32_t x;
+    f32_t y;
+};
+
+// Uniform spatial hash. Positions are copied into the cells so queries
+// never have to touch component storage.
+typedef struct spatial_index_t spatial_index_t;
+struct spatial_index_t {
+    f32_t cell_size;
+    // Packed cell coordinate to the entries in that cell.
+    re_hash_map_t(u64_t, re_dyn_arr_t(spatial_entry_t)) cells;
+    // Amount of keys in 'cells'. Queries covering more cells than this walk the map instead.
+    u32_t cell_count;
+    // Entity to the cell it currently lives in.
+    re_hash_map_t(ecs_id_t, u64_t) entity_cell;
+};
+
+extern spatial_index_t spatial_index_init(f32_t cell_size);
+extern void spatial_index_free(spatial_index_t *index);
+extern spatial_index_t spatial_index_copy(spatial_index_t *index);
+// Insert or move an entity. Only touches the cells if the entity changed cell.
+extern void spatial_index_set(spatial_index_t *index, ecs_id_t entity, f32_t x, f32_t y);
+extern void spatial_index_remove(spatial_index_t *index, ecs_id_t entity);
+// Queries write at most 'capacity' entities to 'result' and return the total amount found.
+extern u32_t spatial_index_query_aabb(const spatial_index_t *index, f32_t min_x, f32_t min_y, f32_t max_x, f32_t max_y, ecs_id_t *result, u32_t capacity);
+extern u32_t spatial_index_query_radius(const spatial_index_t *index, f32_t x, f32_t y, f32_t radius, ecs_id_t *result, u32_t capacity);
 
 /*=========================*/
 // ECS
@@ -115,20 +355,52 @@ struct component_t {
 
 typedef struct ecs_t ecs_t;
 struct ecs_t {
+    // Changes whenever the set of registered components might differ from another world.
+    // Clones inherit it since they share component ids. Used to validate cached component ids.
+    u64_t component_epoch;
     id_handler_t id_handler;
-    re_hash_map_t(ecs_id_t, re_str_t) id_name_map;
-    re_hash_map_t(re_str_t, component_t) component_map;
+    name_table_t name_table;
+    // Bidirectional name index, names are interned in 'name_table'.
+    re_hash_map_t(ecs_id_t, name_t) id_name_map;
+    re_hash_map_t(name_t, ecs_id_t) name_id_map;
+    re_hash_map_t(name_t, component_t) component_map;
     archetype_graph_t archetype_graph;
+
+    // Position component the spatial index is keyed on, U64_MAX if disabled.
+    ecs_id_t spatial_component;
+    spatial_index_t spatial_index;
+    // Entities whose position changed since the last sync.
+    // Index 0 is for the calling thread, index 1 + n for thread pool worker n.
+    re_dyn_arr_t(re_dyn_arr_t(ecs_entity_t)) spatial_dirty;
+
+    // Queries built from plain id lists by 'ecs_iter_init' and 'ecs_parallel_for', keyed by a hash of the terms.
+    re_hash_map_t(u64_t, query_t *) query_cache;
+
+    // Created on the first parallel iteration.
+    thread_pool_t *thread_pool;
+    // Non-zero while a parallel iteration is running.
+    // Structural changes are rejected during that time.
+    u32_t iter_depth;
 };
 
 extern ecs_t *ecs_init(void);
 extern void ecs_free(ecs_t *ecs);
+// Duplicate the whole world, e.g. to snapshot it for rollback or run a speculative simulation.
+// Entity ids stay the same in the clone. Queries must be recreated on the clone.
+extern ecs_t *ecs_clone(ecs_t *ecs);
 
 extern ecs_entity_t ecs_entity_new(ecs_t *ecs);
+// Thread safe entity creation for workers owning an id cache made from 'ecs->id_handler'.
+extern ecs_entity_t ecs_entity_new_cached(ecs_t *ecs, id_cache_t *cache);
 extern void ecs_entity_destroy(ecs_t *ecs, ecs_entity_t entity);
 extern b8_t ecs_entity_alive(ecs_t *ecs, ecs_entity_t entity);
 extern void ecs_entity_name_set(ecs_t *ecs, ecs_entity_t entity, re_str_t name);
 extern re_str_t ecs_entity_name_get(ecs_t *ecs, ecs_entity_t entity);
+// Find an entity by name. Returns U64_MAX if no entity has that name.
+extern ecs_entity_t ecs_entity_lookup(ecs_t *ecs, re_str_t name);
+extern ecs_entity_t ecs_entity_lookup_name(ecs_t *ecs, name_t name);
+// Returns a component with an id of U64_MAX if it hasn't been registered.
+extern component_t ecs_component_lookup(ecs_t *ecs, name_t name);
 extern void ecs_entity_add(ecs_t *ecs, ecs_entity_t entity, ecs_entity_t id);
 extern void ecs_entity_remove(ecs_t *ecs, ecs_entity_t entity, ecs_entity_t id);
 extern void ecs_entity_storage(ecs_t *ecs, ecs_entity_t entity, u64_t size);
@@ -138,6 +410,136 @@ extern void *ecs_entity_storage_get(ecs_t *ecs, ecs_entity_t entity, ecs_id_t id
 
 extern void _ecs_register_component_impl(ecs_t *ecs, u64_t size, re_str_t name);
 
+// Index all entities with 'component' by the first two floats of it, e.g. a 're_vec2_t'.
+extern void ecs_spatial_enable(ecs_t *ecs, ecs_id_t component, f32_t cell_size);
+extern void ecs_spatial_disable(ecs_t *ecs);
+// Flag that the position of 'entity' has been written.
+// Safe to call from parallel iteration, every worker marks into its own list.
+extern void ecs_spatial_mark(ecs_t *ecs, ecs_entity_t entity);
+// Make room for a dirty list per thread pool worker. Called when the pool gets created.
+extern void ecs_spatial_reserve_workers(ecs_t *ecs);
+// Re-bucket all marked entities. Must be called before querying for the changes to be visible.
+// Enabling, disabling and syncing aren't allowed during parallel iteration.
+extern void ecs_spatial_sync(ecs_t *ecs);
+extern u32_t ecs_spatial_query_aabb(ecs_t *ecs, f32_t min_x, f32_t min_y, f32_t max_x, f32_t max_y, ecs_entity_t *result, u32_t capacity);
+extern u32_t ecs_spatial_query_radius(ecs_t *ecs, f32_t x, f32_t y, f32_t radius, ecs_entity_t *result, u32_t capacity);
+
+// Target amount of column data processed by a single parallel job.
+// Small enough to stay in L1/L2 while big enough to amortize scheduling.
+#define ECS_PARALLEL_CHUNK_SIZE KB(16)
+
+// 'columns' holds one pointer per requested id, offset to the first row of the chunk.
+// Ids without storage get a NULL column.
+typedef void (*ecs_parallel_func_t)(void **columns, u32_t count, void *user_data);
+
+// Columns are passed per term. Not terms and missing optional or or terms get a NULL column.
+extern query_t *ecs_query_new(ecs_t *ecs, const query_term_t *terms, u32_t term_count);
+extern void ecs_query_free(ecs_t *ecs, query_t *query);
+extern void ecs_query_each(ecs_t *ecs, query_t *query, ecs_parallel_func_t func, void *user_data);
+// Get a query owned by the ecs matching the terms, creating it on first use.
+// NULL if it doesn't exist yet and can't be created because a parallel iteration is running.
+extern query_t *ecs_query_cached(ecs_t *ecs, const query_term_t *terms, u32_t term_count);
+
+// Run 'func' over every entity having all of 'ids', split in cache sized chunks across the thread pool.
+// Blocks until all chunks are done. 'ecs_entity_storage_get' may be called from within 'func'
+// but adding, removing, destroying or naming entities, attaching storage, creating or freeing
+// queries or starting another parallel iteration is not allowed until it returns.
+// Matching goes through a cached query so at most 'QUERY_TERM_MAX' ids are supported.
+extern void ecs_parallel_for(ecs_t *ecs, const ecs_id_t *ids, u32_t id_count, ecs_parallel_func_t func, void *user_data);
+
+/*=========================*/
+// Typed access
+/*=========================*/
+
+// Walks the non empty archetypes matched by a query, one archetype per 'ecs_iter_next'.
+typedef struct ecs_iter_t ecs_iter_t;
+struct ecs_iter_t {
+    ecs_t *ecs;
+    query_t *query;
+    u32_t match;
+
+    // Column base pointers of the current archetype, one per term.
+    void *columns[QUERY_TERM_MAX];
+    u32_t count;
+};
+
+// Iterate every entity having all of 'ids' through a cached query.
+extern ecs_iter_t ecs_iter_init(ecs_t *ecs, const ecs_id_t *ids, u32_t id_count);
+extern ecs_iter_t ecs_iter_query(ecs_t *ecs, query_t *query);
+extern b8_t ecs_iter_next(ecs_iter_t *iter);
+
+// Id of a component registered with 'ecs_register_component'.
+// Looked up once per call site, thread and component epoch, then cached in thread local statics.
+// Failed lookups aren't cached so the component can be registered later.
+#define ecs_component_id(ECS, T) ({ \
+        static __thread u64_t _ecs_cached_epoch = 0; \
+        static __thread ecs_id_t _ecs_cached_id = U64_MAX; \
+        ecs_t *_ecs_world = (ECS); \
+        ecs_id_t _ecs_id = _ecs_cached_id; \
+        if (_ecs_cached_epoch != _ecs_world->component_epoch) { \
+            _ecs_id = ecs_component_lookup(_ecs_world, name_lit(#T)).id; \
+            if (_ecs_id != U64_MAX) { \
+                _ecs_cached_id = _ecs_id; \
+                _ecs_cached_epoch = _ecs_world->component_epoch; \
+            } \
+        } \
+        _ecs_id; \
+    })
+
+#define ecs_get(ECS, ENTITY, T) ((T *) ecs_entity_storage_get((ECS), (ENTITY), ecs_component_id((ECS), T)))
+// Typed column inside a parallel or query callback.
+#define ecs_column(COLUMNS, INDEX, T) ((T *) (COLUMNS)[(INDEX)])
+
+// Run the trailing body once per entity having all listed components, with each
+// name bound to a typed pointer to that entity's component. Rows are walked through
+// restrict qualified typed columns so the compiler sees a constant stride and can vectorize.
+//
+// ecs_each2(ecs, position_t, pos, velocity_t, vel, {
+//     pos->x += vel->x;
+//     pos->y += vel->y;
+// });
+#define ecs_each1(ECS, T1, N1, ...) do { \
+        ecs_id_t _ecs_ids[] = {ecs_component_id((ECS), T1)}; \
+        ecs_iter_t _ecs_iter = ecs_iter_init((ECS), _ecs_ids, 1); \
+        while (ecs_iter_next(&_ecs_iter)) { \
+            T1 *restrict _ecs_col1 = _ecs_iter.columns[0]; \
+            for (u32_t _ecs_i = 0; _ecs_i < _ecs_iter.count; _ecs_i++) { \
+                T1 *N1 = &_ecs_col1[_ecs_i]; \
+                __VA_ARGS__ \
+            } \
+        } \
+    } while (0)
+
+#define ecs_each2(ECS, T1, N1, T2, N2, ...) do { \
+        ecs_id_t _ecs_ids[] = {ecs_component_id((ECS), T1), ecs_component_id((ECS), T2)}; \
+        ecs_iter_t _ecs_iter = ecs_iter_init((ECS), _ecs_ids, 2); \
+        while (ecs_iter_next(&_ecs_iter)) { \
+            T1 *restrict _ecs_col1 = _ecs_iter.columns[0]; \
+            T2 *restrict _ecs_col2 = _ecs_iter.columns[1]; \
+            for (u32_t _ecs_i = 0; _ecs_i < _ecs_iter.count; _ecs_i++) { \
+                T1 *N1 = &_ecs_col1[_ecs_i]; \
+                T2 *N2 = &_ecs_col2[_ecs_i]; \
+                __VA_ARGS__ \
+            } \
+        } \
+    } while (0)
+
+#define ecs_each3(ECS, T1, N1, T2, N2, T3, N3, ...) do { \
+        ecs_id_t _ecs_ids[] = {ecs_component_id((ECS), T1), ecs_component_id((ECS), T2), ecs_component_id((ECS), T3)}; \
+        ecs_iter_t _ecs_iter = ecs_iter_init((ECS), _ecs_ids, 3); \
+        while (ecs_iter_next(&_ecs_iter)) { \
+            T1 *restrict _ecs_col1 = _ecs_iter.columns[0]; \
+            T2 *restrict _ecs_col2 = _ecs_iter.columns[1]; \
+            T3 *restrict _ecs_col3 = _ecs_iter.columns[2]; \
+            for (u32_t _ecs_i = 0; _ecs_i < _ecs_iter.count; _ecs_i++) { \
+                T1 *N1 = &_ecs_col1[_ecs_i]; \
+                T2 *N2 = &_ecs_col2[_ecs_i]; \
+                T3 *N3 = &_ecs_col3[_ecs_i]; \
+                __VA_ARGS__ \
+            } \
+        } \
+    } while (0)
+
 
 
 extern void archetype_graph_print(ecs_t *ecs, archetype_graph_t graph);
@@ -1,44 +1,117 @@
 #include "core.h"
 #include "rebound.h"
 
-static u64_t str_hash(const void *key, u64_t size) {
-    (void) size;
-    const re_str_t *str = key;
-    return re_fvn1a_hash(str->str, str->len);
-}
-
-static b8_t str_eq(const void *a, const void *b, u32_t size) {
-    (void) size;
-    const re_str_t *_a = a;
-    const re_str_t *_b = b;
-    return re_str_cmp(*_a, *_b) == 0;
+static u64_t ecs_next_component_epoch(void) {
+    static u64_t epoch_counter = 0;
+    return __atomic_add_fetch(&epoch_counter, 1, __ATOMIC_RELAXED);
 }
 
 ecs_t *ecs_init(void) {
     ecs_t *ecs = re_malloc(sizeof(ecs_t));
     *ecs = (ecs_t) {0};
 
+    ecs->component_epoch = ecs_next_component_epoch();
+
+    id_handler_init(&ecs->id_handler);
+
+    ecs->name_table = name_table_init();
+    re_hash_map_init(ecs->name_id_map, (name_t) {0}, U64_MAX, name_hash, name_eq);
+
     component_t null_comp = {U64_MAX, 0};
-    re_hash_map_init(ecs->component_map, re_str_null, null_comp, str_hash, str_eq);
+    re_hash_map_init(ecs->component_map, (name_t) {0}, null_comp, name_hash, name_eq);
 
     ecs->archetype_graph = archetype_graph_init();
+    ecs->spatial_component = U64_MAX;
 
     return ecs;
 }
 
 void ecs_free(ecs_t *ecs) {
+    ecs_spatial_disable(ecs);
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(ecs->query_cache);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(ecs->query_cache, iter)) {
+        ecs_query_free(ecs, re_hash_map_get_index_value(ecs->query_cache, iter));
+    }
+    re_hash_map_free(ecs->query_cache);
+    if (ecs->thread_pool != NULL) {
+        thread_pool_free(ecs->thread_pool);
+    }
     id_handler_free(&ecs->id_handler);
     re_hash_map_free(ecs->id_name_map);
+    re_hash_map_free(ecs->name_id_map);
     re_hash_map_free(ecs->component_map);
+    name_table_free(&ecs->name_table);
+    archetype_graph_free(&ecs->archetype_graph);
 
     re_free(ecs);
 }
 
+ecs_t *ecs_clone(ecs_t *ecs) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't clone during parallel iteration.");
+        return NULL;
+    }
+
+    ecs_t *clone = ecs_init();
+
+    id_handler_copy(&clone->id_handler, &ecs->id_handler);
+    // Component ids are the same so cached ids stay valid for the clone.
+    clone->component_epoch = ecs->component_epoch;
+
+    // Names are interned again so the clone owns its own strings.
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(ecs->id_name_map);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(ecs->id_name_map, iter)) {
+        ecs_id_t id = re_hash_map_get_index_key(ecs->id_name_map, iter);
+        name_t name = name_table_intern(&clone->name_table, re_hash_map_get_index_value(ecs->id_name_map, iter));
+        re_hash_map_set(clone->id_name_map, id, name);
+        re_hash_map_set(clone->name_id_map, name, id);
+    }
+
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(ecs->component_map);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(ecs->component_map, iter)) {
+        name_t name = name_table_intern(&clone->name_table, re_hash_map_get_index_key(ecs->component_map, iter));
+        component_t comp = re_hash_map_get_index_value(ecs->component_map, iter);
+        re_hash_map_set(clone->component_map, name, comp);
+    }
+
+    archetype_graph_free(&clone->archetype_graph);
+    clone->archetype_graph = archetype_graph_copy(&ecs->archetype_graph);
+
+    if (ecs->spatial_component != U64_MAX) {
+        clone->spatial_component = ecs->spatial_component;
+        clone->spatial_index = spatial_index_copy(&ecs->spatial_index);
+        // The clone has no workers yet, merge all pending marks into its calling thread list.
+        re_dyn_arr_push(clone->spatial_dirty, NULL);
+        for (u32_t i = 0; i < re_dyn_arr_count(ecs->spatial_dirty); i++) {
+            re_dyn_arr_t(ecs_entity_t) dirty = ecs->spatial_dirty[i];
+            re_dyn_arr_push_arr(clone->spatial_dirty[0], dirty, re_dyn_arr_count(dirty));
+        }
+    }
+
+    return clone;
+}
+
 void _ecs_register_component_impl(ecs_t *ecs, u64_t size, re_str_t name) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't register a component during parallel iteration.");
+        return;
+    }
+
     ecs_entity_t ent = ecs_entity_new(ecs);
     ecs_entity_name_set(ecs, ent, name);
     ecs_entity_storage(ecs, ent, size);
 
+    // Invalidate component ids cached for this world, its clones don't know about this component.
+    ecs->component_epoch = ecs_next_component_epoch();
+
     component_t comp = {ent, size};
-    re_hash_map_set(ecs->component_map, name, comp);
+    name_t interned = name_table_intern(&ecs->name_table, name_from_str(name));
+    re_hash_map_set(ecs->component_map, interned, comp);
+}
+
+component_t ecs_component_lookup(ecs_t *ecs, name_t name) {
+    return re_hash_map_get(ecs->component_map, name);
 }
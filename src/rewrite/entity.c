@@ -6,8 +6,27 @@ ecs_entity_t ecs_entity_new(ecs_t *ecs) {
     return ent;
 }
 
+ecs_entity_t ecs_entity_new_cached(ecs_t *ecs, id_cache_t *cache) {
+    RE_ASSERT(cache->handler == &ecs->id_handler, "Id cache doesn't belong to this ecs.");
+    ecs_entity_t ent = id_cache_new(cache);
+    return ent;
+}
+
 void ecs_entity_destroy(ecs_t *ecs, ecs_entity_t entity) {
-    re_hash_map_remove(ecs->id_name_map, entity);
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't destroy an entity during parallel iteration.");
+        return;
+    }
+
+    if (ecs->spatial_component != U64_MAX) {
+        spatial_index_remove(&ecs->spatial_index, entity);
+    }
+
+    if (re_hash_map_has(ecs->id_name_map, entity)) {
+        name_t name = re_hash_map_get(ecs->id_name_map, entity);
+        re_hash_map_remove(ecs->name_id_map, name);
+        re_hash_map_remove(ecs->id_name_map, entity);
+    }
     id_handler_dispose(&ecs->id_handler, entity);
 }
 
@@ -16,12 +35,37 @@ b8_t ecs_entity_alive(ecs_t *ecs, ecs_entity_t entity) {
 }
 
 void ecs_entity_name_set(ecs_t *ecs, ecs_entity_t entity, re_str_t name) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't set the name of an entity during parallel iteration.");
+        return;
+    }
+
     if (!id_valid(&ecs->id_handler, entity)) {
         re_log_error("Can't set the name of a dead entity.");
         return;
     }
 
-    re_hash_map_set(ecs->id_name_map, entity, name);
+    name_t interned = name_table_intern(&ecs->name_table, name_from_str(name));
+
+    if (re_hash_map_has(ecs->name_id_map, interned)) {
+        ecs_entity_t owner = re_hash_map_get(ecs->name_id_map, interned);
+        if (owner == entity) {
+            return;
+        }
+
+        if (id_valid(&ecs->id_handler, owner)) {
+            re_log_error("Name '%.*s' is already used by another entity.", (i32_t) name.len, name.str);
+            return;
+        }
+    }
+
+    // Drop the old name from the reverse index.
+    if (re_hash_map_has(ecs->id_name_map, entity)) {
+        re_hash_map_remove(ecs->name_id_map, re_hash_map_get(ecs->id_name_map, entity));
+    }
+
+    re_hash_map_set(ecs->id_name_map, entity, interned);
+    re_hash_map_set(ecs->name_id_map, interned, entity);
 }
 
 re_str_t ecs_entity_name_get(ecs_t *ecs, ecs_entity_t entity) {
@@ -30,23 +74,69 @@ re_str_t ecs_entity_name_get(ecs_t *ecs, ecs_entity_t entity) {
         return re_str_null;
     }
 
-    return re_hash_map_get(ecs->id_name_map, entity);
+    if (!re_hash_map_has(ecs->id_name_map, entity)) {
+        return re_str_null;
+    }
+
+    return re_hash_map_get(ecs->id_name_map, entity).str;
+}
+
+ecs_entity_t ecs_entity_lookup(ecs_t *ecs, re_str_t name) {
+    return ecs_entity_lookup_name(ecs, name_from_str(name));
+}
+
+ecs_entity_t ecs_entity_lookup_name(ecs_t *ecs, name_t name) {
+    if (!re_hash_map_has(ecs->name_id_map, name)) {
+        return U64_MAX;
+    }
+
+    ecs_entity_t entity = re_hash_map_get(ecs->name_id_map, name);
+    if (!id_valid(&ecs->id_handler, entity)) {
+        return U64_MAX;
+    }
+
+    return entity;
 }
 
 void ecs_entity_add(ecs_t *ecs, ecs_entity_t entity, ecs_entity_t id) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't add to an entity during parallel iteration.");
+        return;
+    }
+
     archetype_record_t record = archetype_graph_get_id(&ecs->archetype_graph, entity);
     archetype_graph_record_add(&ecs->archetype_graph, record, id);
+
+    // Storage is uninitialized until the caller writes it, defer to the next sync.
+    if (id == ecs->spatial_component) {
+        ecs_spatial_mark(ecs, entity);
+    }
 }
 
 void ecs_entity_remove(ecs_t *ecs, ecs_entity_t entity, ecs_entity_t id) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't remove from an entity during parallel iteration.");
+        return;
+    }
+
     archetype_record_t record = archetype_graph_get_id(&ecs->archetype_graph, entity);
     archetype_graph_record_remove(&ecs->archetype_graph, record, id);
+
+    if (id == ecs->spatial_component) {
+        spatial_index_remove(&ecs->spatial_index, entity);
+    }
 }
 
 void ecs_entity_storage(ecs_t *ecs, ecs_entity_t entity, u64_t size) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't attach storage during parallel iteration.");
+        return;
+    }
+
     archetype_add_storage_id(&ecs->archetype_graph, entity, size);
 }
 
+// Only reads from the archetype graph so it's safe to call from parallel iteration.
 void *ecs_entity_storage_get(ecs_t *ecs, ecs_entity_t entity, ecs_id_t id) {
     archetype_record_t record = archetype_graph_get_id(&ecs->archetype_graph, entity);
     void *result = archetype_get_storage_id(ecs->archetype_graph, record, id);
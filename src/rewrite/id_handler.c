@@ -6,23 +6,92 @@
 //     8 bits - nothing
 //     8 bits - flags
 
+void id_handler_init(id_handler_t *handler) {
+    *handler = (id_handler_t) {0};
+    pthread_rwlock_init(&handler->lock, NULL);
+}
+
+void id_handler_copy(id_handler_t *dst, id_handler_t *src) {
+    pthread_rwlock_rdlock(&src->lock);
+
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(src->gen_map);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(src->gen_map, iter)) {
+        u32_t id = re_hash_map_get_index_key(src->gen_map, iter);
+        u16_t gen = re_hash_map_get_index_value(src->gen_map, iter);
+        re_hash_map_set(dst->gen_map, id, gen);
+    }
+    re_dyn_arr_push_arr(dst->free_ids, src->free_ids, re_dyn_arr_count(src->free_ids));
+
+    dst->range_lower = src->range_lower;
+    dst->range_upper = src->range_upper;
+    dst->range_offest = src->range_offest;
+
+    // The copy has no caches of its own, the ranges are still reserved but free to claim.
+    for (u32_t i = 0; i < re_dyn_arr_count(src->reserved_ranges); i++) {
+        id_range_t range = src->reserved_ranges[i];
+        range.in_use = false;
+        re_dyn_arr_push(dst->reserved_ranges, range);
+    }
+
+    pthread_rwlock_unlock(&src->lock);
+}
+
 void id_handler_free(id_handler_t *handler) {
     re_hash_map_free(handler->gen_map);
     re_dyn_arr_free(handler->free_ids);
+    re_dyn_arr_free(handler->reserved_ranges);
+    re_dyn_arr_free(handler->invalidations);
+    pthread_rwlock_destroy(&handler->lock);
     *handler = (id_handler_t) {0};
 }
 
-void id_handler_set_range(id_handler_t *handler, u32_t lower_bound, u32_t upper_bound) {
-    if (lower_bound > upper_bound) {
-        re_log_error("Lower bound can't be bigger than upper bound.");
-        return;
+static ecs_id_t id_compose(u32_t data, u16_t gen) {
+    return (ecs_id_t) data | ((ecs_id_t) gen << 32);
+}
+
+// First id data at or after 'data' that isn't part of a reserved cache range.
+// Handler lock must be held.
+static u32_t id_handler_skip_reserved(id_handler_t *handler, u32_t data) {
+    b8_t moved = true;
+    while (moved) {
+        moved = false;
+        for (u32_t i = 0; i < re_dyn_arr_count(handler->reserved_ranges); i++) {
+            id_range_t range = handler->reserved_ranges[i];
+            if (data >= range.lower && data <= range.upper) {
+                data = range.upper + 1;
+                moved = true;
+            }
+        }
     }
 
-    handler->range_lower = lower_bound;
-    handler->range_upper = upper_bound;
-    handler->range_offest = 0;
+    return data;
+}
 
-    // Invalidate all id's within the bound.
+// Drop pending id's in an invalidated range that its owner will hand out again
+// and refresh the generation of the rest.
+// Handler lock must be held.
+static void id_list_invalidate(id_handler_t *handler, re_dyn_arr_t(ecs_id_t) *list, id_invalidation_t invalidation) {
+    for (u32_t i = 0; i < re_dyn_arr_count(*list);) {
+        u32_t data = id_get_data((*list)[i]);
+        if (data < invalidation.lower || data > invalidation.upper) {
+            i++;
+            continue;
+        }
+
+        if (invalidation.keep_reserved && id_handler_skip_reserved(handler, data) != data) {
+            (*list)[i] = id_compose(data, re_hash_map_get(handler->gen_map, data));
+            i++;
+            continue;
+        }
+
+        re_dyn_arr_remove_fast(*list, i);
+    }
+}
+
+// Bump the generation of all id's within the bounds.
+// Handler lock must be held for writing.
+static void id_handler_invalidate(id_handler_t *handler, u32_t lower_bound, u32_t upper_bound, b8_t keep_reserved) {
     for (re_hash_map_iter_t iter = re_hash_map_iter_get(handler->gen_map);
         re_hash_map_iter_valid(iter);
         iter = re_hash_map_iter_next(handler->gen_map, iter)) {
@@ -32,65 +101,120 @@ void id_handler_set_range(id_handler_t *handler, u32_t lower_bound, u32_t upper_
             (*gen)++;
         }
     }
+
+    id_invalidation_t invalidation = {lower_bound, upper_bound, keep_reserved};
+    id_list_invalidate(handler, &handler->free_ids, invalidation);
+
+    // Caches pick this up on their next allocation.
+    re_dyn_arr_push(handler->invalidations, invalidation);
+    __atomic_store_n(&handler->invalidation_count, re_dyn_arr_count(handler->invalidations), __ATOMIC_RELEASE);
 }
 
-static ecs_id_t id_compose(u32_t data, u16_t gen) {
-    return (ecs_id_t) data | ((ecs_id_t) gen << 32);
+void id_handler_set_range(id_handler_t *handler, u32_t lower_bound, u32_t upper_bound) {
+    if (lower_bound > upper_bound) {
+        re_log_error("Lower bound can't be bigger than upper bound.");
+        return;
+    }
+
+    pthread_rwlock_wrlock(&handler->lock);
+
+    handler->range_lower = lower_bound;
+    handler->range_upper = upper_bound;
+    handler->range_offest = 0;
+
+    // Invalidate all id's within the bound. Reserved cache ranges aren't handed
+    // out again by the handler so pending id's in them are kept.
+    id_handler_invalidate(handler, lower_bound, upper_bound, true);
+
+    pthread_rwlock_unlock(&handler->lock);
+}
+
+// Register 'data' if it's new, otherwise keep its generation so
+// handles from before a range reset stay invalid.
+// Handler lock must be held for writing.
+static ecs_id_t id_handler_register(id_handler_t *handler, u32_t data) {
+    if (re_hash_map_has(handler->gen_map, data)) {
+        return id_compose(data, re_hash_map_get(handler->gen_map, data));
+    }
+
+    re_hash_map_set(handler->gen_map, data, 0);
+    return id_compose(data, 0);
 }
 
 ecs_id_t id_handler_new(id_handler_t *handler) {
+    pthread_rwlock_wrlock(&handler->lock);
+
     // Recycle id's.
     if (re_dyn_arr_count(handler->free_ids) != 0) {
-        return re_dyn_arr_pop(handler->free_ids);
+        ecs_id_t id = re_dyn_arr_pop(handler->free_ids);
+        pthread_rwlock_unlock(&handler->lock);
+        return id;
     }
 
     // Generate a new id.
-    if (handler->range_upper != 0 && handler->range_lower + handler->range_offest > handler->range_upper) {
+    u32_t data = id_handler_skip_reserved(handler, handler->range_lower + handler->range_offest);
+    if (handler->range_upper != 0 && data > handler->range_upper) {
+        pthread_rwlock_unlock(&handler->lock);
         re_log_warn("All id's within range has been used up.");
         return U64_MAX;
     }
 
-    u32_t data = handler->range_lower + handler->range_offest;
-    handler->range_offest++;
-    re_hash_map_set(handler->gen_map, data, 0);
+    handler->range_offest = data - handler->range_lower + 1;
+    ecs_id_t id = id_handler_register(handler, data);
 
-    return id_compose(data, 0);
+    pthread_rwlock_unlock(&handler->lock);
+
+    return id;
+}
+
+// Handler lock must be held.
+static b8_t id_valid_locked(id_handler_t *handler, ecs_id_t id) {
+    u32_t data = id_get_data(id);
+    u32_t gen = id_get_gen(id);
+
+    // Id hasn't been registered.
+    if (!re_hash_map_has(handler->gen_map, data)) {
+        return false;
+    }
+
+    // Don't do a bounds check because id's aquired before
+    // range has been set are still valid until disposal.
+
+    return re_hash_map_get(handler->gen_map, data) == gen;
 }
 
 void id_handler_dispose(id_handler_t *handler, ecs_id_t id) {
-    if (!id_valid(handler, id)) {
+    pthread_rwlock_wrlock(&handler->lock);
+
+    if (!id_valid_locked(handler, id)) {
+        pthread_rwlock_unlock(&handler->lock);
         return;
     }
 
     u32_t data = id_get_data(id);
 
-    // Id outside of bounds, discard.
+    u16_t gen = id_get_gen(id);
+    re_hash_map_set(handler->gen_map, data, gen + 1);
+
+    // Id outside of bounds, discard. The generation is kept so the
+    // handle stays dead if the id gets handed out again later.
     if (data < handler->range_lower || data > handler->range_upper) {
-        re_hash_map_remove(handler->gen_map, data);
+        pthread_rwlock_unlock(&handler->lock);
         return;
     }
 
-    u16_t gen = id_get_gen(id);
-    re_hash_map_set(handler->gen_map, data, gen + 1);
-
     // Push a new valid id for id recycling.
     ecs_id_t new_id = id_compose(data, gen + 1);
     re_dyn_arr_push(handler->free_ids, new_id);
+
+    pthread_rwlock_unlock(&handler->lock);
 }
 
 b8_t id_valid(id_handler_t *handler, ecs_id_t id) {
-    u32_t data = id_get_data(id);
-    u32_t gen = id_get_gen(id);
-
-    // Id hasn't been registered.
-    if (!re_hash_map_has(handler->gen_map, data)) {
-        return false;
-    }
-
-    // Don't do a bounds check because id's aquired before
-    // range has been set are still valid until disposal.
-
-    return re_hash_map_get(handler->gen_map, data) == gen;
+    pthread_rwlock_rdlock(&handler->lock);
+    b8_t valid = id_valid_locked(handler, id);
+    pthread_rwlock_unlock(&handler->lock);
+    return valid;
 }
 
 u32_t id_get_data(ecs_id_t id) {
@@ -100,3 +224,200 @@ u32_t id_get_data(ecs_id_t id) {
 u16_t id_get_gen(ecs_id_t id) {
     return (u16_t) (id >> 32);
 }
+
+/*=========================*/
+// ID cache
+/*=========================*/
+
+id_cache_t id_cache_init(id_handler_t *handler) {
+    return (id_cache_t) {
+        .handler = handler,
+        .invalidation_count = __atomic_load_n(&handler->invalidation_count, __ATOMIC_ACQUIRE),
+    };
+}
+
+// Apply the invalidations made since the cache last looked to its lists.
+// Handler lock must be held.
+static void id_cache_apply_invalidations(id_cache_t *cache) {
+    id_handler_t *handler = cache->handler;
+    for (u32_t i = cache->invalidation_count; i < re_dyn_arr_count(handler->invalidations); i++) {
+        id_list_invalidate(handler, &cache->free_ids, handler->invalidations[i]);
+        id_list_invalidate(handler, &cache->reserved, handler->invalidations[i]);
+    }
+    cache->invalidation_count = re_dyn_arr_count(handler->invalidations);
+}
+
+// Hand the pending id's of the cache back to the handler.
+// Handler lock must be held for writing.
+static void id_cache_return_ids(id_cache_t *cache) {
+    id_handler_t *handler = cache->handler;
+
+    id_cache_apply_invalidations(cache);
+    re_dyn_arr_push_arr(handler->free_ids, cache->free_ids, re_dyn_arr_count(cache->free_ids));
+    // Reserved id's are already registered.
+    re_dyn_arr_push_arr(handler->free_ids, cache->reserved, re_dyn_arr_count(cache->reserved));
+
+    re_dyn_arr_free(cache->free_ids);
+    cache->free_ids = NULL;
+    re_dyn_arr_free(cache->reserved);
+    cache->reserved = NULL;
+}
+
+// Handler lock must be held for writing.
+static void id_cache_release_range(id_cache_t *cache) {
+    if (cache->range_upper == 0) {
+        return;
+    }
+
+    id_handler_t *handler = cache->handler;
+    for (u32_t i = 0; i < re_dyn_arr_count(handler->reserved_ranges); i++) {
+        id_range_t *range = &handler->reserved_ranges[i];
+        if (range->lower == cache->range_lower && range->upper == cache->range_upper) {
+            range->in_use = false;
+            return;
+        }
+    }
+}
+
+void id_cache_free(id_cache_t *cache) {
+    id_handler_t *handler = cache->handler;
+
+    pthread_rwlock_wrlock(&handler->lock);
+    id_cache_return_ids(cache);
+    id_cache_release_range(cache);
+    pthread_rwlock_unlock(&handler->lock);
+
+    *cache = (id_cache_t) {0};
+}
+
+void id_cache_set_range(id_cache_t *cache, u32_t lower_bound, u32_t upper_bound) {
+    if (lower_bound > upper_bound) {
+        re_log_error("Lower bound can't be bigger than upper bound.");
+        return;
+    }
+
+    if (upper_bound == 0 || upper_bound == U32_MAX) {
+        re_log_error("Upper bound of an id cache range must be between 0 and U32_MAX.");
+        return;
+    }
+
+    id_handler_t *handler = cache->handler;
+    pthread_rwlock_wrlock(&handler->lock);
+
+    for (u32_t i = 0; i < re_dyn_arr_count(handler->reserved_ranges); i++) {
+        id_range_t range = handler->reserved_ranges[i];
+        if (!range.in_use || upper_bound < range.lower || lower_bound > range.upper) {
+            continue;
+        }
+
+        // The range currently owned by this cache.
+        if (cache->range_upper != 0 && range.lower == cache->range_lower && range.upper == cache->range_upper) {
+            continue;
+        }
+
+        pthread_rwlock_unlock(&handler->lock);
+        re_log_error("Range overlaps the range of another id cache.");
+        return;
+    }
+
+    id_cache_return_ids(cache);
+    id_cache_release_range(cache);
+
+    // Claim an unused reservation of the same range or reserve a new one.
+    b8_t claimed = false;
+    for (u32_t i = 0; i < re_dyn_arr_count(handler->reserved_ranges); i++) {
+        id_range_t *range = &handler->reserved_ranges[i];
+        if (range->lower == lower_bound && range->upper == upper_bound) {
+            range->in_use = true;
+            claimed = true;
+            break;
+        }
+    }
+    if (!claimed) {
+        id_range_t range = {lower_bound, upper_bound, true};
+        re_dyn_arr_push(handler->reserved_ranges, range);
+    }
+
+    // The cache hands out the whole range again, drop every pending id in it.
+    id_handler_invalidate(handler, lower_bound, upper_bound, false);
+    cache->invalidation_count = re_dyn_arr_count(handler->invalidations);
+
+    pthread_rwlock_unlock(&handler->lock);
+
+    cache->range_lower = lower_bound;
+    cache->range_upper = upper_bound;
+    cache->range_offset = 0;
+}
+
+static b8_t id_cache_reserve(id_cache_t *cache) {
+    id_handler_t *handler = cache->handler;
+
+    pthread_rwlock_wrlock(&handler->lock);
+
+    for (u32_t i = 0; i < ID_CACHE_BLOCK_SIZE; i++) {
+        u32_t data;
+        if (cache->range_upper != 0) {
+            data = cache->range_lower + cache->range_offset;
+            if (data > cache->range_upper) {
+                break;
+            }
+            cache->range_offset++;
+        } else {
+            data = id_handler_skip_reserved(handler, handler->range_lower + handler->range_offest);
+            if (handler->range_upper != 0 && data > handler->range_upper) {
+                break;
+            }
+            handler->range_offest = data - handler->range_lower + 1;
+        }
+
+        // Registering the whole block up front means handing out
+        // id's doesn't need to touch the generation map.
+        re_dyn_arr_push(cache->reserved, id_handler_register(handler, data));
+    }
+
+    pthread_rwlock_unlock(&handler->lock);
+
+    return re_dyn_arr_count(cache->reserved) != 0;
+}
+
+ecs_id_t id_cache_new(id_cache_t *cache) {
+    id_handler_t *handler = cache->handler;
+    if (__atomic_load_n(&handler->invalidation_count, __ATOMIC_ACQUIRE) != cache->invalidation_count) {
+        pthread_rwlock_rdlock(&handler->lock);
+        id_cache_apply_invalidations(cache);
+        pthread_rwlock_unlock(&handler->lock);
+    }
+
+    // Recycle id's.
+    if (re_dyn_arr_count(cache->free_ids) != 0) {
+        return re_dyn_arr_pop(cache->free_ids);
+    }
+
+    if (re_dyn_arr_count(cache->reserved) == 0 && !id_cache_reserve(cache)) {
+        re_log_warn("All id's within range has been used up.");
+        return U64_MAX;
+    }
+
+    return re_dyn_arr_pop(cache->reserved);
+}
+
+void id_cache_dispose(id_cache_t *cache, ecs_id_t id) {
+    id_handler_t *handler = cache->handler;
+
+    pthread_rwlock_wrlock(&handler->lock);
+
+    if (!id_valid_locked(handler, id)) {
+        pthread_rwlock_unlock(&handler->lock);
+        return;
+    }
+
+    u32_t data = id_get_data(id);
+    u16_t gen = id_get_gen(id);
+    re_hash_map_set(handler->gen_map, data, gen + 1);
+
+    pthread_rwlock_unlock(&handler->lock);
+
+    // Push a new valid id for id recycling.
+    ecs_id_t new_id = id_compose(data, gen + 1);
+    re_dyn_arr_push(cache->free_ids, new_id);
+}
@@ -0,0 +1,51 @@
+#include "core.h"
+#include "rebound.h"
+
+ecs_iter_t ecs_iter_init(ecs_t *ecs, const ecs_id_t *ids, u32_t id_count) {
+    if (id_count > QUERY_TERM_MAX) {
+        re_log_error("Can't iterate more than %u ids.", QUERY_TERM_MAX);
+        return ecs_iter_query(ecs, NULL);
+    }
+
+    query_term_t terms[QUERY_TERM_MAX] = {0};
+    for (u32_t i = 0; i < id_count; i++) {
+        terms[i] = query_and(ids[i]);
+    }
+
+    return ecs_iter_query(ecs, ecs_query_cached(ecs, terms, id_count));
+}
+
+ecs_iter_t ecs_iter_query(ecs_t *ecs, query_t *query) {
+    return (ecs_iter_t) {
+        .ecs = ecs,
+        .query = query,
+    };
+}
+
+b8_t ecs_iter_next(ecs_iter_t *iter) {
+    query_t *query = iter->query;
+    if (query == NULL) {
+        return false;
+    }
+
+    archetype_graph_t *graph = &iter->ecs->archetype_graph;
+    while (iter->match < re_dyn_arr_count(query->matches)) {
+        archetype_t *archetype = &graph->archetypes[query->matches[iter->match]];
+        iter->match++;
+
+        iter->count = re_dyn_arr_count(archetype->ids);
+        if (iter->count == 0) {
+            continue;
+        }
+
+        for (u32_t i = 0; i < re_dyn_arr_count(query->terms); i++) {
+            query_term_t term = query->terms[i];
+            iter->columns[i] = term.op == QUERY_OP_NOT ? NULL : archetype_get_column(graph, archetype, term.id);
+        }
+
+        return true;
+    }
+
+    iter->count = 0;
+    return false;
+}
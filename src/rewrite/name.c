@@ -0,0 +1,64 @@
+#include "core.h"
+#include "rebound.h"
+
+name_t name_from_str(re_str_t str) {
+    return (name_t) {
+        .str = str,
+        .hash = re_fvn1a_hash(str.str, str.len),
+    };
+}
+
+u64_t name_hash(const void *key, u64_t size) {
+    (void) size;
+    const name_t *name = key;
+    return name->hash;
+}
+
+b8_t name_eq(const void *a, const void *b, u32_t size) {
+    (void) size;
+    const name_t *_a = a;
+    const name_t *_b = b;
+
+    if (_a->hash != _b->hash) {
+        return false;
+    }
+
+    return re_str_cmp(_a->str, _b->str) == 0;
+}
+
+name_table_t name_table_init(void) {
+    name_table_t table = {0};
+    re_hash_map_init(table.map, (name_t) {0}, (name_t) {0}, name_hash, name_eq);
+    return table;
+}
+
+void name_table_free(name_table_t *table) {
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(table->map);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(table->map, iter)) {
+        name_t name = re_hash_map_get_index_key(table->map, iter);
+        re_free((void *) name.str.str);
+    }
+    re_hash_map_free(table->map);
+    *table = (name_table_t) {0};
+}
+
+name_t name_table_intern(name_table_t *table, name_t name) {
+    if (re_hash_map_has(table->map, name)) {
+        return re_hash_map_get(table->map, name);
+    }
+
+    char *bytes = re_malloc(name.str.len);
+    memcpy(bytes, name.str.str, name.str.len);
+
+    name_t owned = {
+        .str = {
+            .str = (const void *) bytes,
+            .len = name.str.len,
+        },
+        .hash = name.hash,
+    };
+    re_hash_map_set(table->map, owned, owned);
+
+    return owned;
+}
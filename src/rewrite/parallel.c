@@ -0,0 +1,99 @@
+#include "core.h"
+#include "rebound.h"
+
+typedef struct parallel_job_t parallel_job_t;
+struct parallel_job_t {
+    ecs_parallel_func_t func;
+    void *user_data;
+
+    // Offset into the shared column pointer list.
+    u32_t column_offset;
+    void **columns;
+    u32_t count;
+};
+
+static void parallel_job_run(void *arg) {
+    parallel_job_t *job = arg;
+    job->func(job->columns, job->count, job->user_data);
+}
+
+void ecs_parallel_for(ecs_t *ecs, const ecs_id_t *ids, u32_t id_count, ecs_parallel_func_t func, void *user_data) {
+    // The calling job would be counted as pending and wait on itself.
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't start a parallel iteration from within another one.");
+        return;
+    }
+
+    if (id_count > QUERY_TERM_MAX) {
+        re_log_error("Parallel iteration supports at most %u ids.", QUERY_TERM_MAX);
+        return;
+    }
+
+    archetype_graph_t *graph = &ecs->archetype_graph;
+
+    // Bytes touched per row, used to size the chunks.
+    u64_t row_size = 0;
+    for (u32_t i = 0; i < id_count; i++) {
+        if (re_hash_map_has(graph->storage_map, ids[i])) {
+            row_size += re_hash_map_get(graph->storage_map, ids[i]);
+        }
+    }
+    u32_t chunk_rows = ECS_PARALLEL_CHUNK_SIZE;
+    if (row_size != 0) {
+        chunk_rows = ECS_PARALLEL_CHUNK_SIZE / row_size;
+        if (chunk_rows == 0) {
+            chunk_rows = 1;
+        }
+    }
+
+    re_dyn_arr_t(void *) columns = NULL;
+    re_dyn_arr_t(parallel_job_t) jobs = NULL;
+
+    ecs_iter_t iter = ecs_iter_init(ecs, ids, id_count);
+    while (ecs_iter_next(&iter)) {
+        u32_t rows = iter.count;
+        for (u32_t start = 0; start < rows; start += chunk_rows) {
+            parallel_job_t job = {
+                .func = func,
+                .user_data = user_data,
+                .column_offset = re_dyn_arr_count(columns),
+                .count = rows - start < chunk_rows ? rows - start : chunk_rows,
+            };
+
+            for (u32_t j = 0; j < id_count; j++) {
+                void *column = iter.columns[j];
+                if (column != NULL) {
+                    column += start * re_dyn_arr_size(column);
+                }
+                re_dyn_arr_push(columns, column);
+            }
+
+            re_dyn_arr_push(jobs, job);
+        }
+    }
+
+    if (re_dyn_arr_count(jobs) == 0) {
+        re_dyn_arr_free(columns);
+        return;
+    }
+
+    if (ecs->thread_pool == NULL) {
+        ecs->thread_pool = thread_pool_create(0);
+        ecs_spatial_reserve_workers(ecs);
+    }
+
+    // Column list is done growing, resolve the offsets.
+    for (u32_t i = 0; i < re_dyn_arr_count(jobs); i++) {
+        jobs[i].columns = &columns[jobs[i].column_offset];
+    }
+
+    ecs->iter_depth++;
+    for (u32_t i = 0; i < re_dyn_arr_count(jobs); i++) {
+        thread_pool_submit(ecs->thread_pool, parallel_job_run, &jobs[i]);
+    }
+    thread_pool_wait(ecs->thread_pool);
+    ecs->iter_depth--;
+
+    re_dyn_arr_free(columns);
+    re_dyn_arr_free(jobs);
+}
@@ -0,0 +1,186 @@
+#include "core.h"
+#include "rebound.h"
+
+static void bitset_set(re_dyn_arr_t(u64_t) *bitset, u32_t bit) {
+    while (re_dyn_arr_count(*bitset) <= bit / 64) {
+        re_dyn_arr_push(*bitset, 0);
+    }
+    (*bitset)[bit / 64] |= 1ull << (bit % 64);
+}
+
+query_t *query_create(archetype_graph_t *graph, const query_term_t *terms, u32_t term_count) {
+    if (term_count > QUERY_TERM_MAX) {
+        re_log_error("Query can't have more than %u terms.", QUERY_TERM_MAX);
+        return NULL;
+    }
+
+    for (u32_t i = 0; i < term_count; i++) {
+        if (terms[i].op == QUERY_OP_OR && terms[i].group >= QUERY_TERM_MAX) {
+            re_log_error("Or group index must be less than %u.", QUERY_TERM_MAX);
+            return NULL;
+        }
+    }
+
+    query_t *query = re_malloc(sizeof(query_t));
+    *query = (query_t) {0};
+
+    for (u32_t i = 0; i < term_count; i++) {
+        query_term_t term = terms[i];
+        re_dyn_arr_push(query->terms, term);
+
+        u32_t bit = archetype_graph_id_bit(graph, term.id);
+        switch (term.op) {
+            case QUERY_OP_AND:
+                bitset_set(&query->and_mask, bit);
+                break;
+            case QUERY_OP_NOT:
+                bitset_set(&query->not_mask, bit);
+                break;
+            case QUERY_OP_OPTIONAL:
+                break;
+            case QUERY_OP_OR:
+                while (re_dyn_arr_count(query->or_masks) <= term.group) {
+                    re_dyn_arr_push(query->or_masks, NULL);
+                }
+                bitset_set(&query->or_masks[term.group], bit);
+                break;
+        }
+    }
+
+    for (u32_t i = 0; i < re_dyn_arr_count(graph->archetypes); i++) {
+        if (query_match(query, &graph->archetypes[i])) {
+            re_dyn_arr_push(query->matches, i);
+        }
+    }
+
+    re_dyn_arr_push(graph->queries, query);
+
+    return query;
+}
+
+void query_free(archetype_graph_t *graph, query_t *query) {
+    for (u32_t i = 0; i < re_dyn_arr_count(graph->queries); i++) {
+        if (graph->queries[i] == query) {
+            re_dyn_arr_remove_fast(graph->queries, i);
+            break;
+        }
+    }
+
+    for (u32_t i = 0; i < re_dyn_arr_count(query->or_masks); i++) {
+        re_dyn_arr_free(query->or_masks[i]);
+    }
+    re_dyn_arr_free(query->or_masks);
+    re_dyn_arr_free(query->and_mask);
+    re_dyn_arr_free(query->not_mask);
+    re_dyn_arr_free(query->terms);
+    re_dyn_arr_free(query->matches);
+    re_free(query);
+}
+
+b8_t query_match(const query_t *query, const archetype_t *archetype) {
+    const u64_t *bitset = archetype->bitset;
+    u32_t words = re_dyn_arr_count(bitset);
+
+    // Words past the end of the archetype bitset are all zero.
+    for (u32_t i = 0; i < re_dyn_arr_count(query->and_mask); i++) {
+        u64_t word = i < words ? bitset[i] : 0;
+        if ((word & query->and_mask[i]) != query->and_mask[i]) {
+            return false;
+        }
+    }
+
+    for (u32_t i = 0; i < re_dyn_arr_count(query->not_mask) && i < words; i++) {
+        if ((bitset[i] & query->not_mask[i]) != 0) {
+            return false;
+        }
+    }
+
+    for (u32_t i = 0; i < re_dyn_arr_count(query->or_masks); i++) {
+        const u64_t *mask = query->or_masks[i];
+        // Unused group index.
+        if (mask == NULL) {
+            continue;
+        }
+
+        b8_t any = false;
+        for (u32_t j = 0; j < re_dyn_arr_count(mask) && j < words; j++) {
+            if ((bitset[j] & mask[j]) != 0) {
+                any = true;
+                break;
+            }
+        }
+
+        if (!any) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+query_t *ecs_query_new(ecs_t *ecs, const query_term_t *terms, u32_t term_count) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't create a query during parallel iteration.");
+        return NULL;
+    }
+
+    return query_create(&ecs->archetype_graph, terms, term_count);
+}
+
+void ecs_query_free(ecs_t *ecs, query_t *query) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't free a query during parallel iteration.");
+        return;
+    }
+
+    query_free(&ecs->archetype_graph, query);
+}
+
+void ecs_query_each(ecs_t *ecs, query_t *query, ecs_parallel_func_t func, void *user_data) {
+    ecs_iter_t iter = ecs_iter_query(ecs, query);
+    while (ecs_iter_next(&iter)) {
+        func(iter.columns, iter.count, user_data);
+    }
+}
+
+static b8_t query_terms_eq(const query_t *query, const query_term_t *terms, u32_t term_count) {
+    if (re_dyn_arr_count(query->terms) != term_count) {
+        return false;
+    }
+
+    for (u32_t i = 0; i < term_count; i++) {
+        query_term_t a = query->terms[i];
+        query_term_t b = terms[i];
+        if (a.id != b.id || a.op != b.op || a.group != b.group) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+query_t *ecs_query_cached(ecs_t *ecs, const query_term_t *terms, u32_t term_count) {
+    u64_t hash = re_fvn1a_hash(terms, term_count * sizeof(query_term_t));
+
+    // Probe past hash collisions.
+    while (re_hash_map_has(ecs->query_cache, hash)) {
+        query_t *query = re_hash_map_get(ecs->query_cache, hash);
+        if (query_terms_eq(query, terms, term_count)) {
+            return query;
+        }
+        hash++;
+    }
+
+    // Creating a query writes to the archetype graph.
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't create a query during parallel iteration.");
+        return NULL;
+    }
+
+    query_t *query = ecs_query_new(ecs, terms, term_count);
+    if (query != NULL) {
+        re_hash_map_set(ecs->query_cache, hash, query);
+    }
+
+    return query;
+}
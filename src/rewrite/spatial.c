@@ -0,0 +1,374 @@
+#include "core.h"
+#include "rebound.h"
+
+#include <math.h>
+#include <stdint.h>
+
+static i32_t cell_coord(const spatial_index_t *index, f32_t value) {
+    f32_t cell = floorf(value / index->cell_size);
+
+    // Converting an out of range float to an int is undefined, clamp first.
+    if (isnan(cell)) {
+        return 0;
+    }
+    if (cell <= (f32_t) INT32_MIN) {
+        return INT32_MIN;
+    }
+    if (cell >= 2147483648.0f) {
+        return INT32_MAX;
+    }
+
+    return (i32_t) cell;
+}
+
+static u64_t cell_key(i32_t x, i32_t y) {
+    return ((u64_t) (u32_t) x << 32) | (u32_t) y;
+}
+
+spatial_index_t spatial_index_init(f32_t cell_size) {
+    RE_ASSERT(cell_size > 0.0f, "Cell size must be positive.");
+    return (spatial_index_t) {
+        .cell_size = cell_size,
+    };
+}
+
+void spatial_index_free(spatial_index_t *index) {
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(index->cells);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(index->cells, iter)) {
+        spatial_entry_t *cell = re_hash_map_get_index_value(index->cells, iter);
+        re_dyn_arr_free(cell);
+    }
+    re_hash_map_free(index->cells);
+    re_hash_map_free(index->entity_cell);
+    *index = (spatial_index_t) {0};
+}
+
+spatial_index_t spatial_index_copy(spatial_index_t *index) {
+    spatial_index_t copy = spatial_index_init(index->cell_size);
+
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(index->cells);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(index->cells, iter)) {
+        u64_t key = re_hash_map_get_index_key(index->cells, iter);
+        spatial_entry_t *cell = re_hash_map_get_index_value(index->cells, iter);
+
+        spatial_entry_t *cell_copy = NULL;
+        re_dyn_arr_push_arr(cell_copy, cell, re_dyn_arr_count(cell));
+        re_hash_map_set(copy.cells, key, cell_copy);
+    }
+    copy.cell_count = index->cell_count;
+
+    for (re_hash_map_iter_t iter = re_hash_map_iter_get(index->entity_cell);
+        re_hash_map_iter_valid(iter);
+        iter = re_hash_map_iter_next(index->entity_cell, iter)) {
+        ecs_id_t entity = re_hash_map_get_index_key(index->entity_cell, iter);
+        u64_t key = re_hash_map_get_index_value(index->entity_cell, iter);
+        re_hash_map_set(copy.entity_cell, entity, key);
+    }
+
+    return copy;
+}
+
+static void cell_remove(spatial_index_t *index, u64_t key, ecs_id_t entity) {
+    spatial_entry_t *cell = re_hash_map_get(index->cells, key);
+    for (u32_t i = 0; i < re_dyn_arr_count(cell); i++) {
+        if (cell[i].entity == entity) {
+            re_dyn_arr_remove_fast(cell, i);
+            break;
+        }
+    }
+    // Empty cells are kept around to avoid reallocating when entities move back.
+    re_hash_map_set(index->cells, key, cell);
+}
+
+void spatial_index_set(spatial_index_t *index, ecs_id_t entity, f32_t x, f32_t y) {
+    u64_t key = cell_key(cell_coord(index, x), cell_coord(index, y));
+    spatial_entry_t entry = {entity, x, y};
+
+    if (re_hash_map_has(index->entity_cell, entity)) {
+        u64_t old_key = re_hash_map_get(index->entity_cell, entity);
+
+        // Same cell, only update the position.
+        if (old_key == key) {
+            spatial_entry_t *cell = re_hash_map_get(index->cells, key);
+            for (u32_t i = 0; i < re_dyn_arr_count(cell); i++) {
+                if (cell[i].entity == entity) {
+                    cell[i] = entry;
+                    break;
+                }
+            }
+            return;
+        }
+
+        cell_remove(index, old_key, entity);
+    }
+
+    spatial_entry_t *cell = NULL;
+    if (re_hash_map_has(index->cells, key)) {
+        cell = re_hash_map_get(index->cells, key);
+    } else {
+        index->cell_count++;
+    }
+    re_dyn_arr_push(cell, entry);
+    re_hash_map_set(index->cells, key, cell);
+    re_hash_map_set(index->entity_cell, entity, key);
+}
+
+void spatial_index_remove(spatial_index_t *index, ecs_id_t entity) {
+    if (!re_hash_map_has(index->entity_cell, entity)) {
+        return;
+    }
+
+    cell_remove(index, re_hash_map_get(index->entity_cell, entity), entity);
+    re_hash_map_remove(index->entity_cell, entity);
+}
+
+// Shared by both queries. A radius of less than 0 only tests the box.
+typedef struct spatial_query_t spatial_query_t;
+struct spatial_query_t {
+    f32_t min_x;
+    f32_t min_y;
+    f32_t max_x;
+    f32_t max_y;
+    f32_t cx;
+    f32_t cy;
+    // Less than 0 only tests the box.
+    f32_t radius;
+
+    ecs_id_t *result;
+    u32_t capacity;
+    u32_t found;
+};
+
+static void spatial_query_cell(spatial_query_t *query, const spatial_entry_t *cell) {
+    f32_t radius_sq = query->radius * query->radius;
+
+    for (u32_t i = 0; i < re_dyn_arr_count(cell); i++) {
+        spatial_entry_t entry = cell[i];
+        if (entry.x < query->min_x || entry.x > query->max_x || entry.y < query->min_y || entry.y > query->max_y) {
+            continue;
+        }
+
+        if (query->radius >= 0.0f) {
+            f32_t dx = entry.x - query->cx;
+            f32_t dy = entry.y - query->cy;
+            if (dx * dx + dy * dy > radius_sq) {
+                continue;
+            }
+        }
+
+        if (query->found < query->capacity) {
+            query->result[query->found] = entry.entity;
+        }
+        query->found++;
+    }
+}
+
+static u32_t spatial_index_query(const spatial_index_t *index, spatial_query_t query) {
+    // Also rejects NaN bounds.
+    if (!(query.min_x <= query.max_x && query.min_y <= query.max_y)) {
+        return 0;
+    }
+
+    i64_t cell_min_x = cell_coord(index, query.min_x);
+    i64_t cell_min_y = cell_coord(index, query.min_y);
+    i64_t cell_max_x = cell_coord(index, query.max_x);
+    i64_t cell_max_y = cell_coord(index, query.max_y);
+
+    // Walk the occupied cells when the box covers more cells than there are.
+    u64_t width = cell_max_x - cell_min_x + 1;
+    u64_t height = cell_max_y - cell_min_y + 1;
+    if (width > index->cell_count || height > index->cell_count / width) {
+        for (re_hash_map_iter_t iter = re_hash_map_iter_get(index->cells);
+            re_hash_map_iter_valid(iter);
+            iter = re_hash_map_iter_next(index->cells, iter)) {
+            spatial_query_cell(&query, re_hash_map_get_index_value(index->cells, iter));
+        }
+        return query.found;
+    }
+
+    for (i64_t y = cell_min_y; y <= cell_max_y; y++) {
+        for (i64_t x = cell_min_x; x <= cell_max_x; x++) {
+            u64_t key = cell_key(x, y);
+            if (!re_hash_map_has(index->cells, key)) {
+                continue;
+            }
+
+            spatial_query_cell(&query, re_hash_map_get(index->cells, key));
+        }
+    }
+
+    return query.found;
+}
+
+u32_t spatial_index_query_aabb(const spatial_index_t *index, f32_t min_x, f32_t min_y, f32_t max_x, f32_t max_y, ecs_id_t *result, u32_t capacity) {
+    spatial_query_t query = {
+        .min_x = min_x,
+        .min_y = min_y,
+        .max_x = max_x,
+        .max_y = max_y,
+        .radius = -1.0f,
+        .result = result,
+        .capacity = capacity,
+    };
+    return spatial_index_query(index, query);
+}
+
+u32_t spatial_index_query_radius(const spatial_index_t *index, f32_t x, f32_t y, f32_t radius, ecs_id_t *result, u32_t capacity) {
+    spatial_query_t query = {
+        .min_x = x - radius,
+        .min_y = y - radius,
+        .max_x = x + radius,
+        .max_y = y + radius,
+        .cx = x,
+        .cy = y,
+        .radius = radius,
+        .result = result,
+        .capacity = capacity,
+    };
+    return spatial_index_query(index, query);
+}
+
+/*=========================*/
+// ECS integration
+/*=========================*/
+
+void ecs_spatial_enable(ecs_t *ecs, ecs_id_t component, f32_t cell_size) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't enable the spatial index during parallel iteration.");
+        return;
+    }
+
+    archetype_graph_t *graph = &ecs->archetype_graph;
+
+    if (!re_hash_map_has(graph->storage_map, component) || re_hash_map_get(graph->storage_map, component) < sizeof(f32_t) * 2) {
+        re_log_error("Spatial component needs storage for at least two floats.");
+        return;
+    }
+
+    ecs_spatial_disable(ecs);
+    ecs->spatial_component = component;
+    ecs->spatial_index = spatial_index_init(cell_size);
+    ecs_spatial_reserve_workers(ecs);
+
+    // Index everything that already has a position.
+    for (u32_t i = 0; i < re_dyn_arr_count(graph->archetypes); i++) {
+        archetype_t *archetype = &graph->archetypes[i];
+        u8_t *column = archetype_get_column(graph, archetype, component);
+        if (column == NULL) {
+            continue;
+        }
+
+        u64_t stride = re_dyn_arr_size(column);
+        for (u32_t row = 0; row < re_dyn_arr_count(archetype->ids); row++) {
+            const f32_t *pos = (const f32_t *) (column + row * stride);
+            spatial_index_set(&ecs->spatial_index, archetype->ids[row], pos[0], pos[1]);
+        }
+    }
+}
+
+void ecs_spatial_disable(ecs_t *ecs) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't disable the spatial index during parallel iteration.");
+        return;
+    }
+
+    if (ecs->spatial_component == U64_MAX) {
+        return;
+    }
+
+    spatial_index_free(&ecs->spatial_index);
+    for (u32_t i = 0; i < re_dyn_arr_count(ecs->spatial_dirty); i++) {
+        re_dyn_arr_free(ecs->spatial_dirty[i]);
+    }
+    re_dyn_arr_free(ecs->spatial_dirty);
+    ecs->spatial_dirty = NULL;
+    ecs->spatial_component = U64_MAX;
+}
+
+void ecs_spatial_mark(ecs_t *ecs, ecs_entity_t entity) {
+    if (ecs->spatial_component == U64_MAX) {
+        return;
+    }
+
+    u32_t list = 0;
+    if (ecs->thread_pool != NULL) {
+        u32_t worker = thread_pool_worker_index(ecs->thread_pool);
+        if (worker != U32_MAX) {
+            list = worker + 1;
+        }
+    }
+
+    re_dyn_arr_push(ecs->spatial_dirty[list], entity);
+}
+
+void ecs_spatial_reserve_workers(ecs_t *ecs) {
+    if (ecs->spatial_component == U64_MAX) {
+        return;
+    }
+
+    u32_t lists = 1;
+    if (ecs->thread_pool != NULL) {
+        lists += re_dyn_arr_count(ecs->thread_pool->threads);
+    }
+
+    while (re_dyn_arr_count(ecs->spatial_dirty) < lists) {
+        re_dyn_arr_push(ecs->spatial_dirty, NULL);
+    }
+}
+
+static void ecs_spatial_sync_entity(ecs_t *ecs, ecs_entity_t entity) {
+    archetype_record_t record = archetype_graph_get_id(&ecs->archetype_graph, entity);
+
+    const f32_t *pos = NULL;
+    if (id_valid(&ecs->id_handler, entity)) {
+        pos = archetype_get_storage_id(ecs->archetype_graph, record, ecs->spatial_component);
+    }
+
+    if (pos == NULL) {
+        spatial_index_remove(&ecs->spatial_index, entity);
+        return;
+    }
+
+    spatial_index_set(&ecs->spatial_index, entity, pos[0], pos[1]);
+}
+
+void ecs_spatial_sync(ecs_t *ecs) {
+    if (ecs->iter_depth != 0) {
+        re_log_error("Can't sync the spatial index during parallel iteration.");
+        return;
+    }
+
+    if (ecs->spatial_component == U64_MAX) {
+        return;
+    }
+
+    // Duplicate marks are harmless, the latest position is read each time.
+    for (u32_t i = 0; i < re_dyn_arr_count(ecs->spatial_dirty); i++) {
+        re_dyn_arr_t(ecs_entity_t) dirty = ecs->spatial_dirty[i];
+        for (u32_t j = 0; j < re_dyn_arr_count(dirty); j++) {
+            ecs_spatial_sync_entity(ecs, dirty[j]);
+        }
+        // Keep the capacity around for the next frame.
+        re_dyn_arr_clear(ecs->spatial_dirty[i]);
+    }
+}
+
+u32_t ecs_spatial_query_aabb(ecs_t *ecs, f32_t min_x, f32_t min_y, f32_t max_x, f32_t max_y, ecs_entity_t *result, u32_t capacity) {
+    if (ecs->spatial_component == U64_MAX) {
+        re_log_error("Spatial index hasn't been enabled.");
+        return 0;
+    }
+
+    return spatial_index_query_aabb(&ecs->spatial_index, min_x, min_y, max_x, max_y, result, capacity);
+}
+
+u32_t ecs_spatial_query_radius(ecs_t *ecs, f32_t x, f32_t y, f32_t radius, ecs_entity_t *result, u32_t capacity) {
+    if (ecs->spatial_component == U64_MAX) {
+        re_log_error("Spatial index hasn't been enabled.");
+        return 0;
+    }
+
+    return spatial_index_query_radius(&ecs->spatial_index, x, y, radius, result, capacity);
+}
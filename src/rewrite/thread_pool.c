@@ -0,0 +1,117 @@
+#include "core.h"
+#include "rebound.h"
+
+#include <unistd.h>
+
+static __thread thread_pool_t *current_pool = NULL;
+static __thread u32_t current_index = U32_MAX;
+
+static void *thread_pool_worker(void *arg) {
+    thread_pool_t *pool = arg;
+
+    current_pool = pool;
+    current_index = __atomic_fetch_add(&pool->worker_counter, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (pool->running && re_dyn_arr_count(pool->jobs) == 0) {
+            pthread_cond_wait(&pool->job_cond, &pool->mutex);
+        }
+
+        // Drain the queue before shutting down.
+        if (re_dyn_arr_count(pool->jobs) == 0) {
+            break;
+        }
+
+        thread_pool_job_t job = re_dyn_arr_pop(pool->jobs);
+        pthread_mutex_unlock(&pool->mutex);
+
+        job.func(job.arg);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->pending--;
+        if (pool->pending == 0) {
+            pthread_cond_broadcast(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+thread_pool_t *thread_pool_create(u32_t thread_count) {
+    if (thread_count == 0) {
+        i64_t cores = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cores > 0 ? cores : 1;
+    }
+
+    thread_pool_t *pool = re_malloc(sizeof(thread_pool_t));
+    *pool = (thread_pool_t) {0};
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->job_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pool->running = true;
+
+    for (u32_t i = 0; i < thread_count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, thread_pool_worker, pool) != 0) {
+            re_log_error("Failed to create thread pool worker.");
+            break;
+        }
+        re_dyn_arr_push(pool->threads, thread);
+    }
+
+    return pool;
+}
+
+void thread_pool_free(thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->running = false;
+    pthread_cond_broadcast(&pool->job_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (u32_t i = 0; i < re_dyn_arr_count(pool->threads); i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->job_cond);
+    pthread_cond_destroy(&pool->done_cond);
+
+    re_dyn_arr_free(pool->threads);
+    re_dyn_arr_free(pool->jobs);
+    re_free(pool);
+}
+
+void thread_pool_submit(thread_pool_t *pool, thread_pool_func_t func, void *arg) {
+    // No workers, run it in place.
+    if (re_dyn_arr_count(pool->threads) == 0) {
+        func(arg);
+        return;
+    }
+
+    thread_pool_job_t job = {func, arg};
+
+    pthread_mutex_lock(&pool->mutex);
+    re_dyn_arr_push(pool->jobs, job);
+    pool->pending++;
+    pthread_cond_signal(&pool->job_cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+u32_t thread_pool_worker_index(thread_pool_t *pool) {
+    if (current_pool != pool) {
+        return U32_MAX;
+    }
+
+    return current_index;
+}
+
+void thread_pool_wait(thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending != 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}